@@ -0,0 +1,17 @@
+# 3-tape Turing machine, recognizing the language {a^n b^n c^n : n >= 0}
+num-tapes: 3
+input-alphabet: a b c
+
+# mark the beginning of the 2nd and the 3rd tape
+(start) a _ _ (copyA) a X X - > >
+(start) _ _ _ (accept) _ _ _ - - -
+
+# copy a's to the 2nd tape and b's to the 3rd tape
+(copyA) a _ _ (copyA) a a _ > > -
+(copyA) b _ _ (copyB) b _ b > - >
+(copyB) b _ _ (copyB) b _ b > - >
+
+# for every c, go back by one a and one b
+(copyB) c _ _ (check) c _ _ - < <
+(check) c a b (check) c a b > < <
+(check) _ X X (accept) _ X X - - -
@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "turing_machine.h"
+
+using namespace std;
+
+// Runs a machine and its translation (see translate_tm) on every input word up to a given length,
+// and on random longer words, and reports the first input on which they disagree.
+
+static void print_usage(string error) {
+    cerr << "ERROR: " << error << "\n"
+         << "Usage: tm_checker [--max-length <n>] [--samples <count>] [--sample-length <n>] [--max-steps <n>]\n"
+         << "                  [--slowdown <c>] [--threads <count>] [--seed <n>] <input_file>\n";
+    exit(1);
+}
+
+// min_value is 0 or 1
+static long long parse_number(const string &option, const char *value, long long min_value, long long max_value) {
+    try {
+        size_t last;
+        long long res = stoll(value, &last);
+        if (last == string(value).length() && res >= min_value && res <= max_value)
+            return res;
+    } catch (...) {
+    }
+    print_usage(string(min_value > 0 ? "Positive" : "Nonnegative") + " integer expected after " + option);
+    return 0;
+}
+
+enum Verdict { AGREE, INCONCLUSIVE, DISAGREE };
+
+struct Checker {
+    const vector<string> &input_alphabet;
+    CompiledTuringMachine original;
+    CompiledTuringMachine translated;
+    int num_tapes;
+    long long max_steps;
+    long long slowdown;
+
+    Checker(const TuringMachine &tm, const TuringMachine &one_tape_tm, long long max_steps_, long long slowdown_)
+        : input_alphabet(tm.input_alphabet), original(tm), translated(one_tape_tm), num_tapes(tm.num_tapes),
+          max_steps(max_steps_), slowdown(slowdown_) {}
+
+    // the translated tape holds k tapes of at most n + steps + 1 cells each, plus k separators,
+    // and every simulated step sweeps over it a constant number of times, plus once for each
+    // of the up to k - 1 shifts; the initialization sweeps over it once more
+    long long translated_step_limit(size_t n, long long steps) const {
+        double cells = (double)n + (double)num_tapes * (steps + 2) + 8;
+        double limit = (double)slowdown * ((double)num_tapes * (steps + 1) * cells + cells);
+        return limit >= (double)LLONG_MAX / 2 ? LLONG_MAX / 2 : (long long)limit;
+    }
+
+    Verdict compare(const vector<string> &word, string *report = nullptr) const {
+        long long original_steps, translated_steps;
+        RunResult original_result = original.run(original.encode_input(word), max_steps, original_steps);
+        if (original_result == RUN_STEP_LIMIT)
+            return INCONCLUSIVE;
+        long long limit = translated_step_limit(word.size(), original_steps);
+        RunResult translated_result = translated.run(translated.encode_input(word), limit, translated_steps);
+        if (translated_result == original_result)
+            return AGREE;
+        if (report) {
+            string input;
+            for (const auto &letter: word)
+                input += letter;
+            *report = "input \"" + input + "\": the original machine " + result_name(original_result)
+                      + " after " + to_string(original_steps) + " steps, the translated one "
+                      + result_name(translated_result) + " after " + to_string(translated_steps) + " steps";
+        }
+        return DISAGREE;
+    }
+
+    static string result_name(RunResult result) {
+        return result == RUN_ACCEPT ? "accepts" : result == RUN_REJECT ? "rejects" : "does not halt";
+    }
+
+    // the index-th word of the given length, in the lexicographic order
+    vector<string> word_of_length(size_t length, long long index) const {
+        vector<string> word(length);
+        for (size_t pos = length; pos-- > 0;) {
+            word[pos] = input_alphabet[index % input_alphabet.size()];
+            index /= input_alphabet.size();
+        }
+        return word;
+    }
+
+    vector<string> random_word(long long seed, long long sample, size_t min_length, size_t max_length) const {
+        seed_seq seq{seed, sample};
+        mt19937_64 rng(seq);
+        size_t length = uniform_int_distribution<size_t>(min_length, max_length)(rng);
+        uniform_int_distribution<size_t> letter(0, input_alphabet.size() - 1);
+        vector<string> word(length);
+        for (auto &el: word)
+            el = input_alphabet[letter(rng)];
+        return word;
+    }
+
+    // greedily removes letters, as long as the machines still disagree
+    vector<string> minimize(vector<string> word) const {
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (size_t pos = 0; pos < word.size();) {
+                vector<string> shorter = word;
+                shorter.erase(shorter.begin() + pos);
+                if (compare(shorter) == DISAGREE) {
+                    word = shorter;
+                    changed = true;
+                } else
+                    ++pos;
+            }
+        }
+        return word;
+    }
+};
+
+// runs check(index) for indices 0, 1, ..., count - 1 on num_threads threads, stopping early
+// on a disagreement; returns the smallest index for which check returned DISAGREE (or count)
+template<typename Check>
+static long long find_first_disagreement(long long count, int num_threads, atomic<long long> &inconclusive, Check check) {
+    const long long CHUNK = 256;
+    atomic<long long> next_index(0);
+    atomic<long long> first_disagreement(count);
+    vector<thread> threads;
+    for (int t = 0; t < num_threads; ++t)
+        threads.emplace_back([&]() {
+            for (;;) {
+                long long start = next_index.fetch_add(CHUNK);
+                if (start >= first_disagreement)
+                    return;
+                for (long long index = start; index < min(start + CHUNK, count) && index < first_disagreement; ++index) {
+                    Verdict verdict = check(index);
+                    if (verdict == INCONCLUSIVE)
+                        ++inconclusive;
+                    if (verdict == DISAGREE) {
+                        long long cur = first_disagreement;
+                        while (index < cur && !first_disagreement.compare_exchange_weak(cur, index));
+                    }
+                }
+            }
+        });
+    for (auto &thread: threads)
+        thread.join();
+    return first_disagreement;
+}
+
+int main(int argc, char* argv[]) {
+    string filename;
+    long long max_length = 8;
+    long long samples = 1000;
+    long long sample_length = 32;
+    long long max_steps = 100000;
+    long long slowdown = 16;
+    long long num_threads = max(1u, thread::hardware_concurrency());
+    long long seed = 0;
+    int ok = 0;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg.substr(0, 2) == "--") {
+            long long *value = nullptr;
+            long long min_value = 0, max_value = LLONG_MAX;
+            if (arg == "--max-length")
+                value = &max_length;
+            else if (arg == "--samples")
+                value = &samples;
+            else if (arg == "--sample-length")
+                value = &sample_length;
+            else if (arg == "--max-steps")
+                value = &max_steps;
+            else if (arg == "--slowdown") {
+                value = &slowdown;
+                min_value = 1;
+            } else if (arg == "--threads") {
+                value = &num_threads;
+                min_value = 1;
+                max_value = INT_MAX;
+            } else if (arg == "--seed")
+                value = &seed;
+            else
+                print_usage("Unknown option " + arg);
+            if (i + 1 == argc)
+                print_usage("Missing value after " + arg);
+            *value = parse_number(arg, argv[++i], min_value, max_value);
+        } else {
+            if (ok == 0)
+                filename = arg;
+            else
+                print_usage("Too many arguments");
+            ++ok;
+        }
+    }
+    if (ok != 1)
+        print_usage("Not enough arguments");
+
+    FILE *f = fopen(filename.c_str(), "r");
+    if (!f) {
+        cerr << "ERROR: File " << filename << " does not exist\n";
+        return 1;
+    }
+    TuringMachine tm = read_tm_or_exit(f);
+    Checker checker(tm, translate_tm(tm), max_steps, slowdown);
+
+    // all words up to max_length, shortest first, so the first disagreement is a minimal one
+    const long long MAX_WORDS = LLONG_MAX / 2;
+    vector<long long> words_shorter_than(1, 0);
+    long long count = 1;
+    for (long long length = 0; length <= max_length; ++length) {
+        if (length > 0) {
+            if (count > MAX_WORDS / (long long)tm.input_alphabet.size()) {
+                cerr << "ERROR: Too many words of length at most " << max_length << "\n";
+                return 1;
+            }
+            count *= tm.input_alphabet.size();
+        }
+        if (words_shorter_than.back() > MAX_WORDS - count) {
+            cerr << "ERROR: Too many words of length at most " << max_length << "\n";
+            return 1;
+        }
+        words_shorter_than.emplace_back(words_shorter_than.back() + count);
+    }
+    auto word_at = [&](long long index) {
+        size_t length = upper_bound(words_shorter_than.begin(), words_shorter_than.end(), index) - words_shorter_than.begin() - 1;
+        return checker.word_of_length(length, index - words_shorter_than[length]);
+    };
+
+    atomic<long long> inconclusive(0);
+    long long num_words = words_shorter_than.back();
+    long long first = find_first_disagreement(num_words, num_threads, inconclusive, [&](long long index) {
+        return checker.compare(word_at(index));
+    });
+    vector<string> counterexample;
+    bool found = first < num_words;
+    if (found)
+        counterexample = word_at(first);
+
+    long long min_sample_length = max_length + 1;
+    if (!found && samples > 0 && sample_length >= min_sample_length) {
+        long long first_sample = find_first_disagreement(samples, num_threads, inconclusive, [&](long long sample) {
+            return checker.compare(checker.random_word(seed, sample, min_sample_length, sample_length));
+        });
+        found = first_sample < samples;
+        if (found)
+            counterexample = checker.minimize(checker.random_word(seed, first_sample, min_sample_length, sample_length));
+    } else if (!found)
+        samples = 0;
+
+    if (found) {
+        string report;
+        checker.compare(counterexample, &report);
+        cout << "MISMATCH on " << report << "\n";
+        return 1;
+    }
+    cout << "OK: " << num_words + samples << " inputs checked, on " << inconclusive
+         << " of them the original machine did not halt within " << max_steps << " steps\n";
+    return 0;
+}
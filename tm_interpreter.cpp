@@ -1,7 +1,22 @@
 #include <iostream>
+#include <fstream>
 #include <sstream>
+#include <cerrno>
+#include <climits>
+#include <condition_variable>
+#include <csignal>
 #include <cstddef>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
 #include "turing_machine.h"
 
 using namespace std;
@@ -10,10 +25,26 @@ static bool verbose = true;
 
 static void print_usage(string error) {
     cerr << "ERROR: " << error << "\n"
-         << "Usage: tm_interpreter [-q|--quiet] <input_file> <input>\n";
+         << "Usage: tm_interpreter [-q|--quiet] [--profile <profile_file>] [--layout <profile_file>]\n"
+         << "                      [--tape-dir <directory> [--page-size <cells>] [--resident-pages <count>]] <input_file> <input>\n"
+         << "       tm_interpreter --server [--socket <path>] [--workers <count>]\n";
     exit(1);
 }
 
+static long long parse_positive_number(const string &option, const char *value, long long max_value) {
+    try {
+        size_t last;
+        long long res = stoll(value, &last);
+        if (last == string(value).length() && res > 0 && res <= max_value)
+            return res;
+    } catch (...) {
+    }
+    if (max_value < LLONG_MAX)
+        print_usage("Integer between 1 and " + to_string(max_value) + " expected after " + option);
+    print_usage("Positive integer expected after " + option);
+    return 0;
+}
+
 void halt(bool accept) {
     cout << (accept ? "ACCEPT" : "REJECT") << "\n";
     exit(0);
@@ -77,15 +108,335 @@ void print_configuration() {
     cerr << "#####################################\n";
 }
 
+/** SERVER MODE */
+
+// Requests are read line by line, from the standard input or from connections to a Unix socket:
+//     <job_id> <input_file> <max_steps> [<input>]
+// For every request a single line is sent back, once the job is done (so not necessarily in order):
+//     <job_id> ACCEPT <steps>
+//     <job_id> REJECT <steps>
+//     <job_id> LIMIT <steps>        (the machine did not halt within max_steps steps)
+//     <job_id> ERROR <message>
+
+struct CachedMachine {
+    TuringMachine input_parser; // only the input alphabet, the transitions are in compiled
+    CompiledTuringMachine compiled;
+
+    explicit CachedMachine(const TuringMachine &tm)
+        : input_parser(tm.num_tapes, tm.input_alphabet, transitions_t()), compiled(tm) {}
+};
+
+// parsed machines, keyed by the file name and its modification time
+class MachineCache {
+public:
+    shared_ptr<const CachedMachine> get(const string &filename, string &error) {
+        struct stat file_stat;
+        if (stat(filename.c_str(), &file_stat) != 0) {
+            error = "File " + filename + " does not exist";
+            return nullptr;
+        }
+        {
+            lock_guard<mutex> guard(lock);
+            auto it = entries.find(filename);
+            if (it != entries.end() && it->second.mtime.tv_sec == file_stat.st_mtim.tv_sec
+                    && it->second.mtime.tv_nsec == file_stat.st_mtim.tv_nsec)
+                return it->second.machine;
+        }
+        // loaded without holding the lock, so that other jobs are not blocked by a large machine
+        FILE *f = fopen(filename.c_str(), "r");
+        if (!f) {
+            error = "File " + filename + " does not exist";
+            return nullptr;
+        }
+        shared_ptr<const CachedMachine> machine;
+        try {
+            machine = make_shared<const CachedMachine>(read_tm_from_file(f));
+        } catch (const SyntaxError &syntax_error) {
+            error = "File " + filename + " could not be parsed: " + syntax_error.what();
+            return nullptr;
+        }
+        lock_guard<mutex> guard(lock);
+        entries[filename] = Entry{file_stat.st_mtim, machine};
+        return machine;
+    }
+
+private:
+    struct Entry {
+        struct timespec mtime;
+        shared_ptr<const CachedMachine> machine;
+    };
+
+    mutex lock;
+    map<string, Entry> entries;
+};
+
+// where requests come from and where responses go to
+class Connection {
+public:
+    Connection(FILE *input_, int output_fd_, bool owned_) : input(input_), output_fd(output_fd_), owned(owned_) {}
+
+    ~Connection() {
+        if (owned)
+            fclose(input);
+    }
+
+    bool read_line(string &line) {
+        char *buffer = nullptr;
+        size_t size = 0;
+        ssize_t length = getline(&buffer, &size, input);
+        if (length >= 0)
+            line.assign(buffer, length);
+        free(buffer);
+        return length >= 0;
+    }
+
+    // makes read_line return false (for a connection to a socket)
+    void stop_reading() {
+        ::shutdown(output_fd, SHUT_RD);
+    }
+
+    void send(const string &line) {
+        lock_guard<mutex> guard(write_lock);
+        string data = line + "\n";
+        for (size_t done = 0; done < data.length();) {
+            ssize_t written = write(output_fd, data.c_str() + done, data.length() - done);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+                return; // the other side is gone, nobody is waiting for the response
+            done += written;
+        }
+    }
+
+private:
+    FILE *input;
+    int output_fd;
+    bool owned;
+    mutex write_lock;
+};
+
+struct Job {
+    shared_ptr<Connection> connection;
+    string id;
+    string filename;
+    long long max_steps;
+    string input;
+};
+
+class JobQueue {
+public:
+    void push(Job job) {
+        lock_guard<mutex> guard(lock);
+        jobs.emplace_back(move(job));
+        available.notify_one();
+    }
+
+    // false once the queue is closed and empty
+    bool pop(Job &job) {
+        unique_lock<mutex> guard(lock);
+        available.wait(guard, [this]() { return closed || !jobs.empty(); });
+        if (jobs.empty())
+            return false;
+        job = move(jobs.front());
+        jobs.pop_front();
+        return true;
+    }
+
+    void close() {
+        lock_guard<mutex> guard(lock);
+        closed = true;
+        available.notify_all();
+    }
+
+private:
+    mutex lock;
+    condition_variable available;
+    deque<Job> jobs;
+    bool closed = false;
+};
+
+static void run_job(MachineCache &cache, const Job &job) {
+    string error;
+    auto machine = cache.get(job.filename, error);
+    if (!machine) {
+        job.connection->send(job.id + " ERROR " + error);
+        return;
+    }
+    vector<string> input = machine->input_parser.parse_input(job.input);
+    if (input.empty() && job.input != "") {
+        job.connection->send(job.id + " ERROR The input is not a sequence of input letters");
+        return;
+    }
+    long long steps;
+    RunResult result = machine->compiled.run(machine->compiled.encode_input(input), job.max_steps, steps);
+    const char *verdict = result == RUN_ACCEPT ? "ACCEPT" : result == RUN_REJECT ? "REJECT" : "LIMIT";
+    job.connection->send(job.id + " " + verdict + " " + to_string(steps));
+}
+
+static void read_requests(const shared_ptr<Connection> &connection, JobQueue &queue) {
+    string line;
+    while (connection->read_line(line)) {
+        istringstream iss(line);
+        Job job;
+        string max_steps, extra;
+        if (!(iss >> job.id))
+            continue; // an empty line
+        if (!(iss >> job.filename >> max_steps) || (iss >> job.input && iss >> extra)) {
+            connection->send(job.id + " ERROR Expected: <job_id> <input_file> <max_steps> [<input>]");
+            continue;
+        }
+        try {
+            size_t last;
+            job.max_steps = stoll(max_steps, &last);
+            if (last != max_steps.length() || job.max_steps < 0)
+                throw 0;
+        } catch (...) {
+            connection->send(job.id + " ERROR Nonnegative integer expected as max_steps");
+            continue;
+        }
+        job.connection = connection;
+        queue.push(move(job));
+    }
+}
+
+// the threads reading requests from connections to the socket; they push jobs to the queue,
+// so they have to be done before it is destroyed
+class ReaderThreads {
+public:
+    void start(const shared_ptr<Connection> &connection, JobQueue &queue) {
+        {
+            lock_guard<mutex> guard(lock);
+            connections.insert(connection);
+        }
+        thread([this, connection, &queue]() {
+            read_requests(connection, queue);
+            lock_guard<mutex> guard(lock);
+            connections.erase(connection);
+            finished.notify_all();
+        }).detach();
+    }
+
+    void stop() {
+        unique_lock<mutex> guard(lock);
+        for (const auto &connection: connections)
+            connection->stop_reading();
+        finished.wait(guard, [this]() { return connections.empty(); });
+    }
+
+private:
+    mutex lock;
+    condition_variable finished;
+    set<shared_ptr<Connection>> connections;
+};
+
+static int listen_on_socket(const string &path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.length() >= sizeof(address.sun_path)) {
+        cerr << "ERROR: Socket path " << path << " is too long\n";
+        exit(1);
+    }
+    strcpy(address.sun_path, path.c_str());
+    // a socket left by a previous server is replaced, anything else at the path is kept
+    struct stat path_stat;
+    if (lstat(path.c_str(), &path_stat) == 0) {
+        if (!S_ISSOCK(path_stat.st_mode)) {
+            cerr << "ERROR: " << path << " exists and is not a socket\n";
+            exit(1);
+        }
+        unlink(path.c_str());
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        cerr << "ERROR: Cannot listen on socket " << path << ": " << strerror(errno) << "\n";
+        exit(1);
+    }
+    return fd;
+}
+
+static int serve(const string &socket_path, int num_workers) {
+    signal(SIGPIPE, SIG_IGN); // a client may disconnect before getting its responses
+    MachineCache cache;
+    JobQueue queue;
+    vector<thread> workers;
+    for (int w = 0; w < num_workers; ++w)
+        workers.emplace_back([&]() {
+            Job job;
+            while (queue.pop(job)) {
+                run_job(cache, job);
+                job = Job(); // releases the connection
+            }
+        });
+
+    if (socket_path.empty())
+        read_requests(make_shared<Connection>(stdin, STDOUT_FILENO, false), queue);
+    else {
+        ReaderThreads readers;
+        int listen_fd = listen_on_socket(socket_path);
+        for (;;) {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                cerr << "ERROR: Cannot accept a connection: " << strerror(errno) << "\n";
+                break;
+            }
+            FILE *input = fdopen(fd, "r");
+            if (!input) {
+                close(fd);
+                continue;
+            }
+            readers.start(make_shared<Connection>(input, fd, true), queue);
+        }
+        readers.stop();
+    }
+
+    queue.close();
+    for (auto &worker: workers)
+        worker.join();
+    return 0;
+}
+
 int main(int argc, char* argv[]) {
     string filename;
     string input;
+    bool server = false;
+    string socket_path;
+    string profile_filename;
+    string layout_filename;
+    TapeOptions tape_options;
+    int num_workers = max(1u, thread::hardware_concurrency());
+    string single_run_option; // any option that does not apply to --server
     int ok = 0;
     for (int i = 1; i < argc; i++) {
         string arg = argv[i];
+        if (arg == "--quiet" || arg == "-q" || arg == "--profile" || arg == "--layout"
+                || arg == "--tape-dir" || arg == "--page-size" || arg == "--resident-pages")
+            single_run_option = arg;
         if (arg == "--quiet" || arg == "-q")
             verbose = false;
-        else {
+        else if (arg == "--server")
+            server = true;
+        else if (arg == "--socket" || arg == "--workers" || arg == "--profile" || arg == "--layout"
+                 || arg == "--tape-dir" || arg == "--page-size" || arg == "--resident-pages") {
+            if (++i == argc)
+                print_usage("Missing value after " + arg);
+            if (arg == "--socket")
+                socket_path = argv[i];
+            else if (arg == "--profile")
+                profile_filename = argv[i];
+            else if (arg == "--layout")
+                layout_filename = argv[i];
+            else if (arg == "--tape-dir")
+                tape_options.directory = argv[i];
+            else if (arg == "--page-size")
+                tape_options.page_size = parse_positive_number(arg, argv[i], MAX_PAGE_SIZE);
+            else if (arg == "--resident-pages")
+                tape_options.resident_pages = parse_positive_number(arg, argv[i], LLONG_MAX);
+            else
+                num_workers = parse_positive_number(arg, argv[i], INT_MAX);
+        } else {
             if (ok == 0)
                 filename = arg;
             else
@@ -96,15 +447,24 @@ int main(int argc, char* argv[]) {
             ++ok;
         }
     }
+    if (server) {
+        if (ok)
+            print_usage("Too many arguments");
+        if (!single_run_option.empty())
+            print_usage(single_run_option + " cannot be used with --server");
+        return serve(socket_path, num_workers);
+    }
     if (ok != 2)
         print_usage("Not enough arguments");
+    if (verbose && (!profile_filename.empty() || !layout_filename.empty() || !tape_options.directory.empty()))
+        print_usage("--profile, --layout and --tape-dir can only be used with --quiet");
 
     FILE *f = fopen(filename.c_str(), "r");
     if (!f) {
         cerr << "ERROR: File " << filename << " does not exist\n";
         return 1;
     }
-    TuringMachine tm = read_tm_from_file(f);
+    TuringMachine tm = read_tm_or_exit(f);
     tapes.resize(tm.num_tapes);
     heads.resize(tm.num_tapes);
     tapes[0] = tm.parse_input(input);
@@ -112,6 +472,49 @@ int main(int argc, char* argv[]) {
         cerr << "ERROR: The last argument is not a sequence of input letters\n";
         return 1;
     }
+
+    // nothing is printed until the machine halts, so it can run on the compiled transition table
+    if (!verbose) {
+        profile_t layout;
+        if (!layout_filename.empty()) {
+            FILE *layout_file = fopen(layout_filename.c_str(), "r");
+            if (!layout_file) {
+                cerr << "ERROR: File " << layout_filename << " does not exist\n";
+                return 1;
+            }
+            try {
+                layout = read_profile(layout_file);
+            } catch (const SyntaxError &error) {
+                cerr << error.what() << "\n";
+                return 1;
+            }
+        }
+        CompiledTuringMachine compiled(tm, layout_filename.empty() ? nullptr : &layout);
+        vector<long long> hits;
+        if (!profile_filename.empty())
+            hits.resize(compiled.num_transitions());
+        long long steps;
+        RunResult result;
+        try {
+            result = compiled.run(compiled.encode_input(tapes[0]), LLONG_MAX, steps,
+                                  profile_filename.empty() ? nullptr : &hits, &tape_options);
+        } catch (const bad_alloc &) {
+            cerr << "ERROR: Not enough memory for the tapes\n";
+            return 1;
+        } catch (const runtime_error &error) {
+            cerr << "ERROR: " << error.what() << "\n";
+            return 1;
+        }
+        if (!profile_filename.empty()) {
+            ofstream out(profile_filename);
+            if (!out) {
+                cerr << "ERROR: File " << profile_filename << " could not be opened\n";
+                return 1;
+            }
+            save_profile(out, compiled.profile(hits));
+        }
+        halt(result == RUN_ACCEPT);
+    }
     append_blanks_under_heads();
 
     if (verbose)
@@ -1,4 +1,5 @@
 #include <cassert>
+#include <chrono>
 #include <cstddef>
 #include <cstdio>
 #include <cstdlib>
@@ -6,29 +7,74 @@
 #include <fstream>
 #include <set>
 #include <string>
+#include <sys/resource.h>
 #include "turing_machine.h"
 
 using namespace std;
 
 static void print_usage(string error) {
     cerr << "ERROR: " << error << "\n"
-         << "Usage: tm_translator [-q|--quiet] <input_file>\n";
+         << "Usage: tm_translator [--stats] [--stats-json <stats_file>] <input_file> <output_file>\n";
     exit(1);
 }
 
+static void print_stats(ostream &output, const TranslationStats &stats) {
+    output << "working_alphabet():       " << stats.working_alphabet_time << " s\n"
+           << "set_of_states():          " << stats.set_of_states_time << " s\n"
+           << "create_init_transitions:  " << stats.init_transitions_time << " s\n"
+           << "translate_transitions:    " << stats.translate_transitions_time << " s\n"
+           << "save_to_file:             " << stats.save_to_file_time << " s\n"
+           << "transitions:              " << stats.num_transitions << "\n";
+    for (const auto &family: stats.transitions_per_family)
+        output << "  " << family.first << ": " << family.second << "\n";
+    output << "peak RSS:                 " << stats.peak_rss_kb << " KB\n";
+}
+
+static void print_stats_json(ostream &output, const TranslationStats &stats) {
+    // family names are identifiers, so they never need escaping
+    output << "{\n"
+           << "  \"time_seconds\": {\n"
+           << "    \"working_alphabet\": " << stats.working_alphabet_time << ",\n"
+           << "    \"set_of_states\": " << stats.set_of_states_time << ",\n"
+           << "    \"create_init_transitions\": " << stats.init_transitions_time << ",\n"
+           << "    \"translate_transitions\": " << stats.translate_transitions_time << ",\n"
+           << "    \"save_to_file\": " << stats.save_to_file_time << "\n"
+           << "  },\n"
+           << "  \"num_transitions\": " << stats.num_transitions << ",\n"
+           << "  \"transitions_per_family\": {";
+    bool first = true;
+    for (const auto &family: stats.transitions_per_family) {
+        output << (first ? "\n" : ",\n") << "    \"" << family.first << "\": " << family.second;
+        first = false;
+    }
+    output << "\n  },\n"
+           << "  \"peak_rss_kb\": " << stats.peak_rss_kb << "\n"
+           << "}\n";
+}
+
 int main(int argc, char* argv[]) {
     string input_filename;
     string output_filename;
+    bool stats_to_stderr = false;
+    string stats_filename;
     int ok = 0;
     for (int i = 1; i < argc; i++) {
         string arg = argv[i];
-        if (ok == 0)
-            input_filename = arg;
-        else if (ok == 1)
-            output_filename = arg;
-        else
-            print_usage("Too many arguments");
-        ++ok;
+        if (arg == "--stats")
+            stats_to_stderr = true;
+        else if (arg == "--stats-json") {
+            if (++i == argc)
+                print_usage("Missing file name after --stats-json");
+            stats_filename = argv[i];
+        } else {
+            if (ok == 0)
+                input_filename = arg;
+            else if (ok == 1)
+                output_filename = arg;
+            else
+                print_usage("Too many arguments");
+            ++ok;
+        }
     }
     if (ok != 2)
         print_usage("Not enough arguments");
@@ -38,13 +84,11 @@ int main(int argc, char* argv[]) {
         cerr << "ERROR: File " << input_filename << " does not exist\n";
         return 1;
     }
-    TuringMachine tm = read_tm_from_file(f);
-    if (tm.num_tapes != 2) {
-        cerr << "ERROR: The translator only translates two-tape Turing machines\n";
-        return 1;
-    }
+    TuringMachine tm = read_tm_or_exit(f);
 
-    TuringMachine one_tape_tm = translate_tm(tm);
+    bool collect_stats = stats_to_stderr || !stats_filename.empty();
+    TranslationStats stats;
+    TuringMachine one_tape_tm = translate_tm(tm, collect_stats ? &stats : nullptr);
 
     std::ofstream out;
     out.open(output_filename);
@@ -52,8 +96,26 @@ int main(int argc, char* argv[]) {
         cerr << "ERROR: File " << output_filename << " could not be opened\n";
         return 1;
     }
+    auto start = chrono::steady_clock::now();
     out << one_tape_tm;
     out.close();
+    stats.save_to_file_time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    if (collect_stats) {
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) == 0)
+            stats.peak_rss_kb = usage.ru_maxrss; // in kilobytes on Linux
+        if (stats_to_stderr)
+            print_stats(cerr, stats);
+        if (!stats_filename.empty()) {
+            std::ofstream stats_out(stats_filename);
+            if (!stats_out) {
+                cerr << "ERROR: File " << stats_filename << " could not be opened\n";
+                return 1;
+            }
+            print_stats_json(stats_out, stats);
+        }
+    }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -1,10 +1,17 @@
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
 #include <cstddef>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <set>
+#include <sstream>
 #include <string>
+#include <fcntl.h>
+#include <unistd.h>
 #include "turing_machine.h"
 
 using namespace std;
@@ -50,7 +57,7 @@ public:
 
 private:
     FILE *input;
-    int next_char; // we always have the next char here
+    int next_char = 0; // we always have the next char here
     int line = 1;
     
     int get_next_char() {
@@ -107,17 +114,17 @@ static bool is_identifier(string ident) {
 }
 
 TuringMachine::TuringMachine(int num_tapes_, vector<string> input_alphabet_, transitions_t transitions_)
-    : num_tapes(num_tapes_), input_alphabet(input_alphabet_), transitions(transitions_) {
+    : num_tapes(num_tapes_), input_alphabet(input_alphabet_), transitions(move(transitions_)) {
     assert(num_tapes > 0);
     assert(!input_alphabet.empty());
     for (auto letter : input_alphabet)
         assert(is_identifier(letter) && letter != BLANK);
-    for (auto transition : transitions) {
-        auto state_before = transition.first.first;
-        auto letters_before = transition.first.second;
-        auto state_after = get<0>(transition.second);
-        auto letters_after = get<1>(transition.second);
-        auto directions = get<2>(transition.second);
+    for (const auto &transition : transitions) {
+        const auto &state_before = transition.first.first;
+        const auto &letters_before = transition.first.second;
+        const auto &state_after = get<0>(transition.second);
+        const auto &letters_after = get<1>(transition.second);
+        const auto &directions = get<2>(transition.second);
         assert(is_identifier(state_before) && state_before != ACCEPTING_STATE && state_before != REJECTING_STATE && is_identifier(state_after));
         assert(letters_before.size() == (size_t)num_tapes && letters_after.size() == (size_t)num_tapes && directions.length() == (size_t)num_tapes);
         for (int a = 0; a < num_tapes; ++a)
@@ -127,8 +134,9 @@ TuringMachine::TuringMachine(int num_tapes_, vector<string> input_alphabet_, tra
 
 #define syntax_error(reader, message) \
     for(;;) { \
-        cerr << "Syntax error in line " << reader.get_line_num() << ": " << message << "\n"; \
-        exit(1); \
+        ostringstream error; \
+        error << "Syntax error in line " << reader.get_line_num() << ": " << message; \
+        throw SyntaxError(error.str()); \
     }
 
 static string read_identifier(Reader &reader) {
@@ -217,12 +225,21 @@ TuringMachine read_tm_from_file(FILE *input) {
     return TuringMachine(num_tapes, input_alphabet, transitions);
 }
 
+TuringMachine read_tm_or_exit(FILE *input) {
+    try {
+        return read_tm_from_file(input);
+    } catch (const SyntaxError &error) {
+        cerr << error.what() << "\n";
+        exit(1);
+    }
+}
+
 vector<string> TuringMachine::working_alphabet() const {
     set<string> letters(input_alphabet.begin(), input_alphabet.end());
     letters.insert(BLANK);
-    for (auto transition : transitions) {
-        auto letters_before = transition.first.second;
-        auto letters_after = get<1>(transition.second);
+    for (const auto &transition : transitions) {
+        const auto &letters_before = transition.first.second;
+        const auto &letters_after = get<1>(transition.second);
         letters.insert(letters_before.begin(), letters_before.end());
         letters.insert(letters_after.begin(), letters_after.end());
     }
@@ -234,15 +251,15 @@ vector<string> TuringMachine::set_of_states() const {
     states.insert(INITIAL_STATE);
     states.insert(ACCEPTING_STATE);
     states.insert(REJECTING_STATE);
-    for (auto transition : transitions) {
+    for (const auto &transition : transitions) {
         states.insert(transition.first.first);
         states.insert(get<0>(transition.second));
     }
     return vector<string>(states.begin(), states.end());
 }
 
-static void output_vector(ostream &output, vector<string> v) {
-   for (string el : v)
+static void output_vector(ostream &output, const vector<string> &v) {
+   for (const string &el : v)
         output << " " << el;
 }
     
@@ -251,7 +268,7 @@ void TuringMachine::save_to_file(ostream &output) const {
            << INPUT_ALPHABET;
     output_vector(output, input_alphabet);
     output << "\n";
-    for (auto transition : transitions) {
+    for (const auto &transition : transitions) {
         output << transition.first.first;
         output_vector(output, transition.first.second);
         output << " " << get<0>(transition.second);
@@ -278,19 +295,429 @@ vector<string> TuringMachine::parse_input(std::string input) const {
     return res;
 }
 
+/** COMPILED MACHINE */
+
+// above this size the transition table is kept in a hash map
+#define MAX_DENSE_TABLE_SIZE (1 << 22)
+
+static long long hits_of(const map<string, long long> &hits, const string &key) {
+    auto it = hits.find(key);
+    return it == hits.end() ? 0 : it->second;
+}
+
+CompiledTuringMachine::CompiledTuringMachine(const TuringMachine &tm, const profile_t *profile)
+    : num_tapes(tm.num_tapes), states(tm.set_of_states()), letters(tm.working_alphabet()) {
+    vector<const transitions_t::value_type *> order;
+    for (const auto &transition : tm.transitions)
+        order.emplace_back(&transition);
+
+    if (profile) {
+        // the hottest states, letters and transitions go first
+        map<const transitions_t::value_type *, long long> transition_hits;
+        map<string, long long> state_hits, letter_hits;
+        for (auto transition: order) {
+            auto it = profile->find(transition->first);
+            long long hits = it == profile->end() ? 0 : it->second;
+            transition_hits[transition] = hits;
+            state_hits[transition->first.first] += hits;
+            for (const auto &letter: transition->first.second)
+                letter_hits[letter] += hits;
+        }
+        stable_sort(states.begin(), states.end(), [&](const string &x, const string &y) {
+            return hits_of(state_hits, x) > hits_of(state_hits, y);
+        });
+        stable_sort(letters.begin(), letters.end(), [&](const string &x, const string &y) {
+            return hits_of(letter_hits, x) > hits_of(letter_hits, y);
+        });
+        stable_sort(order.begin(), order.end(), [&](const transitions_t::value_type *x, const transitions_t::value_type *y) {
+            return transition_hits.at(x) > transition_hits.at(y);
+        });
+    }
+
+    map<string, int> state_ids;
+    for (size_t id = 0; id < states.size(); ++id)
+        state_ids[states[id]] = id;
+    for (size_t id = 0; id < letters.size(); ++id)
+        letter_ids[letters[id]] = id;
+    initial_state = state_ids.at(INITIAL_STATE);
+    accepting_state = state_ids.at(ACCEPTING_STATE);
+    rejecting_state = state_ids.at(REJECTING_STATE);
+    blank = letter_ids.at(BLANK);
+
+    row_size = 1;
+    wide_keys = false;
+    for (int a = 0; a < num_tapes && !wide_keys; ++a) {
+        if (row_size > UINT64_MAX / letters.size())
+            wide_keys = true;
+        else
+            row_size *= letters.size();
+    }
+    if (row_size > UINT64_MAX / states.size())
+        wide_keys = true;
+    // with a profile, the transitions from a state start at the beginning of a cache line,
+    // so a hot state does not share its cache lines with a cold one
+    const uint64_t ENTRIES_PER_CACHE_LINE = CACHE_LINE_SIZE / sizeof(int);
+    if (profile && row_size <= MAX_DENSE_TABLE_SIZE)
+        row_size = (row_size + ENTRIES_PER_CACHE_LINE - 1) / ENTRIES_PER_CACHE_LINE * ENTRIES_PER_CACHE_LINE;
+    if (wide_keys || row_size > MAX_DENSE_TABLE_SIZE || (!profile && row_size * states.size() > MAX_DENSE_TABLE_SIZE))
+        dense_states = 0;
+    else
+        dense_states = min<uint64_t>(states.size(), MAX_DENSE_TABLE_SIZE / row_size);
+    dense_table.assign(row_size * dense_states, -1);
+
+    for (auto transition : order) {
+        int index = sources.size() / (1 + num_tapes);
+        sources.emplace_back(state_ids.at(transition->first.first));
+        for (int a = 0; a < num_tapes; ++a)
+            sources.emplace_back(letter_ids.at(transition->first.second[a]));
+
+        uint64_t state = sources[index * (1 + num_tapes)];
+        const int *letters_under_heads = &sources[index * (1 + num_tapes) + 1];
+        uint64_t letters_key = 0;
+        for (int a = 0; a < num_tapes; ++a)
+            letters_key = letters_key * letters.size() + letters_under_heads[a];
+        if (wide_keys)
+            wide_table[vector<int>(sources.begin() + index * (1 + num_tapes), sources.end())] = index;
+        else if (state < dense_states)
+            dense_table[state * row_size + letters_key] = index;
+        else
+            sparse_table[state * row_size + letters_key] = index;
+
+        actions.emplace_back(state_ids.at(get<0>(transition->second)));
+        for (int a = 0; a < num_tapes; ++a)
+            actions.emplace_back(letter_ids.at(get<1>(transition->second)[a]));
+        for (int a = 0; a < num_tapes; ++a) {
+            char dir = get<2>(transition->second)[a];
+            actions.emplace_back(dir == HEAD_LEFT ? -1 : dir == HEAD_RIGHT ? 1 : 0);
+        }
+    }
+}
+
+vector<int> CompiledTuringMachine::encode_input(const vector<string> &input) const {
+    vector<int> res;
+    for (const auto &letter: input)
+        res.emplace_back(letter_ids.at(letter));
+    return res;
+}
+
+size_t CompiledTuringMachine::num_transitions() const {
+    return sources.size() / (1 + num_tapes);
+}
+
+int CompiledTuringMachine::find_transition(int state, const int *letters_under_heads) const {
+    if (wide_keys) {
+        vector<int> key(1, state);
+        key.insert(key.end(), letters_under_heads, letters_under_heads + num_tapes);
+        auto it = wide_table.find(key);
+        return it == wide_table.end() ? -1 : it->second;
+    }
+    uint64_t letters_key = 0;
+    for (int a = 0; a < num_tapes; ++a)
+        letters_key = letters_key * letters.size() + letters_under_heads[a];
+    if ((uint64_t)state < dense_states)
+        return dense_table[state * row_size + letters_key];
+    auto it = sparse_table.find(state * row_size + letters_key);
+    return it == sparse_table.end() ? -1 : it->second;
+}
+
+// a tape kept in memory; the cells past its end are blank
+class MemoryTape {
+public:
+    MemoryTape(const vector<int> &input, int blank_) : cells(input), blank(blank_) {}
+    
+    int get(size_t pos) const {
+        return pos < cells.size() ? cells[pos] : blank;
+    }
+    
+    void set(size_t pos, int letter) {
+        if (pos >= cells.size())
+            cells.resize(pos + 1, blank);
+        cells[pos] = letter;
+    }
+
+private:
+    vector<int> cells;
+    int blank;
+};
+
+// a tape kept in an unlinked file, of which only a few most recently used pages are held in memory;
+// the pages that were never written back are blank and take no space in the file
+class PagedTape {
+public:
+    PagedTape(const TapeOptions &options, const vector<int> &input, int blank_)
+        : page_shift(0), max_resident(max<size_t>(1, options.resident_pages)), blank(blank_), current(0), clock(0) {
+        while (((size_t)1 << page_shift) < min<size_t>(options.page_size, MAX_PAGE_SIZE))
+            ++page_shift;
+        page_size = (size_t)1 << page_shift;
+        string path = options.directory + "/tm_tape_XXXXXX";
+        vector<char> name(path.begin(), path.end());
+        name.emplace_back(0);
+        fd = mkstemp(name.data());
+        if (fd < 0)
+            fail("create a tape file in " + options.directory);
+        unlink(name.data());
+        pages.emplace_back();
+        fill_blank(pages[0], 0);
+        for (size_t pos = 0; pos < input.size(); ++pos)
+            set(pos, input[pos]);
+    }
+    
+    PagedTape(PagedTape &&other) noexcept
+        : page_shift(other.page_shift), page_size(other.page_size), max_resident(other.max_resident),
+          blank(other.blank), fd(other.fd), pages(move(other.pages)), written(move(other.written)),
+          current(other.current), clock(other.clock) {
+        other.fd = -1;
+    }
+    
+    PagedTape(const PagedTape &) = delete;
+    
+    ~PagedTape() {
+        if (fd >= 0)
+            close(fd);
+    }
+    
+    int get(size_t pos) {
+        return page_of(pos).cells[pos & (page_size - 1)];
+    }
+    
+    void set(size_t pos, int letter) {
+        Page &page = page_of(pos);
+        page.cells[pos & (page_size - 1)] = letter;
+        page.dirty = true;
+    }
+
+private:
+    struct Page {
+        size_t index;
+        uint64_t last_use;
+        bool dirty;
+        vector<int> cells;
+    };
+    
+    int page_shift;
+    size_t page_size, max_resident;
+    int blank;
+    int fd;
+    vector<Page> pages;  // resident pages
+    vector<bool> written; // page index -> whether it is in the file
+    size_t current;      // the page used most recently
+    uint64_t clock;
+    
+    static void fail(const string &what) {
+        throw runtime_error("Could not " + what + ": " + strerror(errno));
+    }
+    
+    off_t offset(size_t index) const {
+        return (off_t)index * page_size * sizeof(int);
+    }
+    
+    bool in_file(size_t index) const {
+        return index < written.size() && written[index];
+    }
+    
+    Page &page_of(size_t pos) {
+        size_t index = pos >> page_shift;
+        if (pages[current].index != index)
+            switch_to(index);
+        return pages[current];
+    }
+    
+    void switch_to(size_t index) {
+        size_t previous = pages[current].index;
+        current = pages.size();
+        for (size_t i = 0; i < pages.size(); ++i)
+            if (pages[i].index == index)
+                current = i;
+        if (current == pages.size()) {
+            if (pages.size() < max_resident)
+                pages.emplace_back();
+            else {
+                current = 0;
+                for (size_t i = 1; i < pages.size(); ++i)
+                    if (pages[i].last_use < pages[current].last_use)
+                        current = i;
+                write_back(pages[current]);
+            }
+            if (in_file(index))
+                read(pages[current], index);
+            else
+                fill_blank(pages[current], index);
+        }
+        pages[current].last_use = ++clock;
+        
+        // the head will most likely keep moving in the same direction,
+        // so the kernel can start reading the next page while this one is used
+        size_t next = index > previous ? index + 1 : index - 1;
+        if (index != previous && index > 0 && in_file(next) && !is_resident(next))
+            posix_fadvise(fd, offset(next), page_size * sizeof(int), POSIX_FADV_WILLNEED);
+    }
+    
+    bool is_resident(size_t index) const {
+        for (const auto &page: pages)
+            if (page.index == index)
+                return true;
+        return false;
+    }
+    
+    void fill_blank(Page &page, size_t index) {
+        page.index = index;
+        page.dirty = false;
+        page.cells.assign(page_size, blank);
+    }
+    
+    void read(Page &page, size_t index) {
+        page.index = index;
+        page.dirty = false;
+        page.cells.resize(page_size);
+        char *data = (char *)page.cells.data();
+        for (size_t done = 0, size = page_size * sizeof(int); done < size;) {
+            ssize_t res = pread(fd, data + done, size - done, offset(index) + done);
+            if (res <= 0)
+                fail("read a tape file");
+            done += res;
+        }
+    }
+    
+    void write_back(const Page &page) {
+        if (!page.dirty)
+            return;
+        const char *data = (const char *)page.cells.data();
+        for (size_t done = 0, size = page_size * sizeof(int); done < size;) {
+            ssize_t res = pwrite(fd, data + done, size - done, offset(page.index) + done);
+            if (res <= 0)
+                fail("write a tape file");
+            done += res;
+        }
+        if (page.index >= written.size())
+            written.resize(page.index + 1);
+        written[page.index] = true;
+    }
+};
+
+RunResult CompiledTuringMachine::run(const vector<int> &input, long long max_steps, long long &steps,
+                                     vector<long long> *hits, const TapeOptions *tape_options) const {
+    if (tape_options && !tape_options->directory.empty()) {
+        vector<PagedTape> tapes;
+        for (int a = 0; a < num_tapes; ++a)
+            tapes.emplace_back(*tape_options, a ? vector<int>() : input, blank);
+        return run_on(tapes, max_steps, steps, hits);
+    }
+    vector<MemoryTape> tapes;
+    for (int a = 0; a < num_tapes; ++a)
+        tapes.emplace_back(a ? vector<int>() : input, blank);
+    return run_on(tapes, max_steps, steps, hits);
+}
+
+template<typename Tape>
+RunResult CompiledTuringMachine::run_on(vector<Tape> &tapes, long long max_steps, long long &steps,
+                                        vector<long long> *hits) const {
+    vector<size_t> heads(num_tapes, 0);
+    vector<int> letters_under_heads(num_tapes);
+    int state = initial_state;
+    for (steps = 0; steps < max_steps; ++steps) {
+        for (int a = 0; a < num_tapes; ++a)
+            letters_under_heads[a] = tapes[a].get(heads[a]);
+        int index = find_transition(state, letters_under_heads.data());
+        if (index < 0)
+            return RUN_REJECT;
+        if (hits)
+            ++(*hits)[index];
+        const int *action = &actions[index * (1 + 2 * num_tapes)];
+        state = action[0];
+        for (int a = 0; a < num_tapes; ++a) {
+            tapes[a].set(heads[a], action[1 + a]);
+            int move = action[1 + num_tapes + a];
+            if (move < 0 && !heads[a]) {
+                ++steps;
+                return RUN_REJECT;
+            }
+            heads[a] += move;
+        }
+        if (state == rejecting_state || state == accepting_state) {
+            ++steps;
+            return state == accepting_state ? RUN_ACCEPT : RUN_REJECT;
+        }
+    }
+    return RUN_STEP_LIMIT;
+}
+
+profile_t CompiledTuringMachine::profile(const vector<long long> &hits) const {
+    profile_t res;
+    for (size_t index = 0; index < num_transitions(); ++index) {
+        if (!hits[index])
+            continue;
+        const int *source = &sources[index * (1 + num_tapes)];
+        vector<string> letters_before;
+        for (int a = 0; a < num_tapes; ++a)
+            letters_before.emplace_back(letters[source[1 + a]]);
+        res[make_pair(states[source[0]], letters_before)] = hits[index];
+    }
+    return res;
+}
+
+void save_profile(ostream &output, const profile_t &profile) {
+    vector<pair<long long, const profile_t::key_type *>> entries;
+    for (const auto &entry: profile)
+        entries.emplace_back(entry.second, &entry.first);
+    stable_sort(entries.begin(), entries.end(), [](const pair<long long, const profile_t::key_type *> &x,
+                                                   const pair<long long, const profile_t::key_type *> &y) {
+        return x.first > y.first;
+    });
+    output << "# <hits> <state> <letter_on_tape_1> ... <letter_on_tape_k>\n";
+    for (const auto &entry: entries) {
+        output << entry.first << " " << entry.second->first;
+        output_vector(output, entry.second->second);
+        output << "\n";
+    }
+}
+
+profile_t read_profile(FILE *input) {
+    Reader reader(input);
+    profile_t profile;
+    while (reader.is_next_token_available()) {
+        long long hits;
+        try {
+            string hits_str = reader.next_token();
+            size_t last;
+            hits = stoll(hits_str, &last);
+            if (last != hits_str.length() || hits < 0)
+                throw 0;
+        } catch (...) {
+            syntax_error(reader, "Nonnegative integer expected");
+        }
+        string state = read_identifier(reader);
+        vector<string> letters;
+        while (reader.is_next_token_available())
+            letters.emplace_back(read_identifier(reader));
+        reader.go_to_next_line();
+        profile[make_pair(state, letters)] += hits;
+    }
+    return profile;
+}
+
 /** TRANSLATOR */
 
 // The mapping for input alphabet (letter -> letter with head)
 typedef std::map<std::string, std::string> IdentifiersMapping;
 
+// A k-tape machine is simulated on a single tape of the form
+//     <tape 1> SEPARATOR <tape 2> SEPARATOR ... SEPARATOR <tape k> TAPE_END
+// where the letter under each head is replaced by the same letter with a head (see IdentifiersMapping).
+
+static string number_identifier(int number) {
+    return "(" + to_string(number) + ")";
+}
+
 transitions_t create_init_transitions(const TuringMachine &tm, const IdentifiersMapping &mapping,
                                       const string &SEPARATOR, const string &TAPE_END) {
     const string INIT_FIRST_TAPE_STATE = "(init_1st_tape)";
-    const string INIT_SECOND_TAPE_STATE = "(init_2nd_tape)";
     const string INIT_PUT_TAPE_END_STATE = "(init_put_tape_end)";
-    const string INIT_GO_TO_SEPARATOR = "(init_go_to_separator)";
-    const string INIT_GO_TO_BEGINNING_STATE = "(init_go_to_beginning)";
-    const string START_SEARCH_FIRST_HEAD_STATE = "((start)-(search_1st_head))";
+    const string START_COLLECT_STATE = "((start)-(collect))";
+    // states putting a blank with a head on the a-th tape, and the separator after it
+    auto init_tape_state = [](int a) { return "(" + number_identifier(a) + "-(init_tape))"; };
+    auto init_separator_state = [](int a) { return "(" + number_identifier(a) + "-(init_separator))"; };
+    // going back to the beginning, when there are still a heads to pass
+    auto init_go_back_state = [](int a) { return "(" + number_identifier(a) + "-(init_go_back))"; };
 
     transitions_t transitions;
 
@@ -304,206 +731,418 @@ transitions_t create_init_transitions(const TuringMachine &tm, const Identifiers
         transitions[make_pair(INIT_FIRST_TAPE_STATE, vector<string>{letter})] = make_tuple(INIT_FIRST_TAPE_STATE, vector<string>{letter}, ">");
 
         // after the initialization, go to the beginning of the tape
-        transitions[make_pair(INIT_GO_TO_BEGINNING_STATE, vector<string>{letter})] = make_tuple(INIT_GO_TO_BEGINNING_STATE, vector<string>{letter}, "<");
+        transitions[make_pair(init_go_back_state(0), vector<string>{letter})] = make_tuple(init_go_back_state(0), vector<string>{letter}, "<");
 
         // stop at the beginning, that is where the head is located, and go to the starting state of translated Turing Machine
-        transitions[make_pair(INIT_GO_TO_BEGINNING_STATE, vector<string>{mapping.at(letter)})] = make_tuple(START_SEARCH_FIRST_HEAD_STATE, vector<string>{mapping.at(letter)}, "-");
+        transitions[make_pair(init_go_back_state(0), vector<string>{mapping.at(letter)})] = make_tuple(START_COLLECT_STATE, vector<string>{mapping.at(letter)}, "-");
     }
     // at the beginning there could also be a blank with head
-    transitions[make_pair(INIT_GO_TO_BEGINNING_STATE, vector<string>{mapping.at(BLANK)})] = make_tuple(START_SEARCH_FIRST_HEAD_STATE, vector<string>{mapping.at(BLANK)}, "-");
+    transitions[make_pair(init_go_back_state(0), vector<string>{mapping.at(BLANK)})] = make_tuple(START_COLLECT_STATE, vector<string>{mapping.at(BLANK)}, "-");
+
+    // when the blank is found, put there a separator (or the end of tape identifier, if there is only one tape)
+    if (tm.num_tapes == 1)
+        transitions[make_pair(INIT_FIRST_TAPE_STATE, vector<string>{BLANK})] = make_tuple(init_go_back_state(0), vector<string>{TAPE_END}, "<");
+    else
+        transitions[make_pair(INIT_FIRST_TAPE_STATE, vector<string>{BLANK})] = make_tuple(init_tape_state(2), vector<string>{SEPARATOR}, ">");
+
+    // every other tape is a blank with a head, followed by a separator
+    for (int a = 2; a <= tm.num_tapes; ++a) {
+        const string next_state = a < tm.num_tapes ? init_separator_state(a) : INIT_PUT_TAPE_END_STATE;
+        transitions[make_pair(init_tape_state(a), vector<string>{BLANK})] = make_tuple(next_state, vector<string>{mapping.at(BLANK)}, ">");
+        if (a < tm.num_tapes)
+            transitions[make_pair(init_separator_state(a), vector<string>{BLANK})] = make_tuple(init_tape_state(a + 1), vector<string>{SEPARATOR}, ">");
+    }
 
-    // when the blank is found, put there a separator
-    transitions[make_pair(INIT_FIRST_TAPE_STATE, vector<string>{BLANK})] = make_tuple(INIT_SECOND_TAPE_STATE, vector<string>{SEPARATOR}, ">");
+    // at the end, put the end of tape identifier
+    transitions[make_pair(INIT_PUT_TAPE_END_STATE, vector<string>{BLANK})] = make_tuple(init_go_back_state(tm.num_tapes - 1), vector<string>{TAPE_END}, "<");
 
-    // put a blank with a head after the separator
-    transitions[make_pair(INIT_SECOND_TAPE_STATE, vector<string>{BLANK})] = make_tuple(INIT_PUT_TAPE_END_STATE, vector<string>{mapping.at(BLANK)}, ">");
+    // go left to the beginning, passing the heads on tapes k, ..., 2
+    for (int a = tm.num_tapes - 1; a > 0; --a) {
+        transitions[make_pair(init_go_back_state(a), vector<string>{mapping.at(BLANK)})] = make_tuple(init_go_back_state(a - 1), vector<string>{mapping.at(BLANK)}, "<");
+        transitions[make_pair(init_go_back_state(a), vector<string>{SEPARATOR})] = make_tuple(init_go_back_state(a), vector<string>{SEPARATOR}, "<");
+    }
+    if (tm.num_tapes > 1)
+        transitions[make_pair(init_go_back_state(0), vector<string>{SEPARATOR})] = make_tuple(init_go_back_state(0), vector<string>{SEPARATOR}, "<");
 
-    // at the end, put the end of tape identifier
-    transitions[make_pair(INIT_PUT_TAPE_END_STATE, vector<string>{BLANK})] = make_tuple(INIT_GO_TO_SEPARATOR, vector<string>{TAPE_END}, "<");
+    return transitions;
+}
+
+// Every step of the k-tape machine is simulated in two sweeps:
+// * collect: starting at the head on tape 1, go right and gather the letters under the heads on tapes 1, ..., k
+//   in the state; only prefixes of (state, letters) tuples which have a transition are generated,
+//   for any other the translated machine gets stuck, i.e. rejects, as the original one would;
+// * apply: starting at the head on tape k, go left and perform the transition on tapes k, ..., 1;
+//   when a head moves right onto a separator (or the tape end), everything to the right is shifted one cell.
+// The apply sweep ends at the head on tape 1, where the next collect sweep starts.
+//
+// Generated states are tuples of integers and are turned into identifiers only in the end:
+// "(<state>-(<letter_1>)-...-(<letter_j>)-(<tape>)-(<letter>)-(<phase>))", where the letters are the ones
+// collected so far (all k of them for the apply phases), and the tape and the letter are present only if nonnegative.
+enum Phase {
+    COLLECT, SEEK, PUT_LEFT, PUT_RIGHT, PUT_TAPE_END,
+    SHIFT_ALL, SHIFT_END_TAPE, GO_ONE_LEFT_INIT, SHIFT_EACH, SHIFT_PUT, GO_ONE_LEFT, SHIFT_PUT_SEPARATOR,
+    AFTER_SHIFT,
+    HALT // the accepting or the rejecting state itself
+};
 
-    // go one left, where the separator should be
-    transitions[make_pair(INIT_GO_TO_SEPARATOR, vector<string>{mapping.at(BLANK)})] = make_tuple(INIT_GO_TO_SEPARATOR, vector<string>{mapping.at(BLANK)}, "<");
+static const char *const PHASE_NAMES[] = {
+    "collect", "seek", "put_left", "put_right", "put_tape_end",
+    "shift_all", "shift_end_tape", "go_one_left_init_state", "shift_each", "shift_put_state", "go_one_left_state",
+    "shift_put_separator_state",
+    "after_shift",
+    nullptr
+};
 
-    // when the separator is found, go left to the beginning
-    transitions[make_pair(INIT_GO_TO_SEPARATOR, vector<string>{SEPARATOR})] = make_tuple(INIT_GO_TO_BEGINNING_STATE, vector<string>{SEPARATOR}, "<");
+struct GeneratedState {
+    int state; // index in set_of_states
+    int node;  // the letters collected so far, as a node of LetterTrie
+    int tape;  // 1-based, -1 if absent
+    int letter; // symbol id, -1 if absent
+    Phase phase;
 
-    return transitions;
+    GeneratedState(int state_, int node_, Phase phase_, int tape_ = -1, int letter_ = -1)
+        : state(state_), node(node_), tape(tape_), letter(letter_), phase(phase_) {}
+
+    bool operator==(const GeneratedState &other) const {
+        return state == other.state && node == other.node && tape == other.tape
+            && letter == other.letter && phase == other.phase;
+    }
+};
+
+static inline size_t hash_combine(size_t seed, size_t value) {
+    return seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
 }
 
-void translate_state_transitions(transitions_t &transitions, const string &state,
-                                 const TuringMachine &tm, const IdentifiersMapping &mapping,
-                                 const string &SEPARATOR, const string &TAPE_END) {
-    const string SEARCH_1ST_HEAD_STATE = "(" + state + "-(search_1st_head))";
+struct GeneratedStateHash {
+    size_t operator()(const GeneratedState &s) const {
+        size_t res = s.state;
+        res = hash_combine(res, s.node);
+        res = hash_combine(res, s.tape);
+        res = hash_combine(res, s.letter);
+        return hash_combine(res, s.phase);
+    }
+};
+
+typedef pair<GeneratedState, int> generated_key_t; // (state, symbol)
+
+struct GeneratedKeyHash {
+    size_t operator()(const generated_key_t &key) const {
+        return hash_combine(GeneratedStateHash()(key.first), key.second);
+    }
+};
+
+struct GeneratedMove {
+    GeneratedState state;
+    int symbol;
+    char direction;
+};
+
+typedef unordered_map<generated_key_t, GeneratedMove, GeneratedKeyHash> generated_transitions_t;
+
+// Symbols of the one-tape machine: the letters of the working alphabet (ids 0..n-1),
+// the same letters with a head (n..2n-1), the separator (2n), the tape end (2n+1)
+// and the separator which is being shifted to the right (2n+2).
+struct TapeSymbols {
+    int num_letters;
+    int blank;
+    vector<string> names;
+
+    TapeSymbols(const vector<string> &alphabet, const IdentifiersMapping &mapping,
+                const string &SEPARATOR, const string &TAPE_END, const string &SHIFTED_SEPARATOR)
+        : num_letters(alphabet.size()), names(alphabet) {
+        blank = find(alphabet.begin(), alphabet.end(), BLANK) - alphabet.begin();
+        for (const auto &letter: alphabet)
+            names.emplace_back(mapping.at(letter));
+        names.emplace_back(SEPARATOR);
+        names.emplace_back(TAPE_END);
+        names.emplace_back(SHIFTED_SEPARATOR);
+    }
+
+    int with_head(int letter) const {
+        return num_letters + letter;
+    }
+
+    int separator() const {
+        return 2 * num_letters;
+    }
+
+    int tape_end() const {
+        return 2 * num_letters + 1;
+    }
+
+    int shifted_separator() const {
+        return 2 * num_letters + 2;
+    }
+};
 
-    /** Search 1st head (go left) */
-    // when separator is found, go left
-    transitions[make_pair(SEARCH_1ST_HEAD_STATE, vector<string>{SEPARATOR})] = make_tuple(SEARCH_1ST_HEAD_STATE, vector<string>{SEPARATOR}, "<");
-    for (const auto &letterA: tm.working_alphabet()) {
-        // when a letter without a head is found, go left
-        transitions[make_pair(SEARCH_1ST_HEAD_STATE, vector<string>{letterA})] = make_tuple(SEARCH_1ST_HEAD_STATE, vector<string>{letterA}, "<");
+// The tuples of letters read by the transitions of each state, sharing common prefixes;
+// node -1 is the empty prefix of every state.
+struct LetterTrie {
+    vector<int> parent, letter, depth;
+    vector<vector<pair<int, int>>> children; // per node: (letter, child)
+    map<pair<int, int>, int> root_children;  // (state, letter) -> child of the empty prefix of the state
+
+    int child(int state, int node, int next_letter) const {
+        if (node < 0) {
+            auto it = root_children.find(make_pair(state, next_letter));
+            return it == root_children.end() ? -1 : it->second;
+        }
+        for (const auto &el: children[node])
+            if (el.first == next_letter)
+                return el.second;
+        return -1;
+    }
 
-        const string SEARCH_2ND_HEAD_STATE = "(" + state + "-(" + letterA + ")-(search_2nd_head))";
-        // when a letter WITH a head is found, store it in the state and start going right
-        transitions[make_pair(SEARCH_1ST_HEAD_STATE, vector<string>{mapping.at(letterA)})] = make_tuple(SEARCH_2ND_HEAD_STATE, vector<string>{mapping.at(letterA)}, ">");
+    int add_child(int state, int node, int next_letter) {
+        int res = child(state, node, next_letter);
+        if (res >= 0)
+            return res;
+        res = parent.size();
+        parent.emplace_back(node);
+        letter.emplace_back(next_letter);
+        depth.emplace_back(node < 0 ? 1 : depth[node] + 1);
+        children.emplace_back();
+        if (node < 0)
+            root_children[make_pair(state, next_letter)] = res;
+        else
+            children[node].emplace_back(next_letter, res);
+        return res;
+    }
 
-        /** Search 2nd head (go right) */
-        transitions[make_pair(SEARCH_2ND_HEAD_STATE, vector<string>{SEPARATOR})] = make_tuple(SEARCH_2ND_HEAD_STATE, vector<string>{SEPARATOR}, ">");
-        for (const auto &letterB: tm.working_alphabet()) {
-            // when a letter without a head is found, go right
-            transitions[make_pair(SEARCH_2ND_HEAD_STATE, vector<string>{letterB})] = make_tuple(SEARCH_2ND_HEAD_STATE, vector<string>{letterB}, ">");
+    vector<int> letters(int node) const {
+        vector<int> res;
+        for (; node >= 0; node = parent[node])
+            res.emplace_back(letter[node]);
+        reverse(res.begin(), res.end());
+        return res;
+    }
+};
 
-            const string GO_1ST_HEAD_STATE = "(" + state + "-(" + letterA + ")-(" + letterB + ")-(go_1st_head))";
-            // when a letter WITH a head is found, store it in the state and start going left
-            transitions[make_pair(SEARCH_2ND_HEAD_STATE, vector<string>{mapping.at(letterB)})] = make_tuple(GO_1ST_HEAD_STATE, vector<string>{mapping.at(letterB)}, "<");
+// a transition of the original machine, with states and letters as ids
+struct SourceMove {
+    int next_state;
+    vector<int> next_letters;
+    string head_moves;
+};
 
-            // if there is no transition from <(state), letterA, letterB>, then there is no need to create any more transitions
-            if (tm.transitions.find(make_pair(state, vector<string>{letterA, letterB})) == tm.transitions.end()) {
+class TransitionsTranslator {
+public:
+    TransitionsTranslator(generated_transitions_t &transitions_, const TapeSymbols &symbols_, int num_tapes_)
+        : transitions(transitions_), symbols(symbols_), num_tapes(num_tapes_) {}
+
+    // the collect sweep of the given state, once the letters in node have been read
+    void translate_collect(int state, int node, const LetterTrie &trie, const vector<int> &next_letters,
+                           const map<int, SourceMove> &moves, const vector<bool> &halting) {
+        const GeneratedState COLLECT_STATE(state, node, COLLECT);
+        int depth = node < 0 ? 0 : trie.depth[node];
+        if (depth > 0) {
+            // when a letter without a head or a separator is found, go right
+            for (int letter = 0; letter < symbols.num_letters; ++letter)
+                add(COLLECT_STATE, letter, COLLECT_STATE, letter, '>');
+            add(COLLECT_STATE, symbols.separator(), COLLECT_STATE, symbols.separator(), '>');
+        }
+        // when a letter WITH a head is found, store it in the state
+        for (int letter: next_letters) {
+            int child = trie.child(state, node, letter);
+            if (depth + 1 < num_tapes) {
+                add(COLLECT_STATE, symbols.with_head(letter), GeneratedState(state, child, COLLECT), symbols.with_head(letter), '>');
                 continue;
             }
-            // else, prepare for creating the next transition
-            auto next_move = tm.transitions.at(make_pair(state, vector<string>{letterA, letterB}));
-            string next_state = get<0>(next_move);
-
-            vector<string> next_letters = get<1>(next_move);
-            string head_moves = get<2>(next_move);
-
-            const char tape_1st_head_move = head_moves[0];
-            const char tape_2nd_head_move = head_moves[1];
-            const string tape_1st_next_letter = next_letters[0];
-            const string tape_2nd_next_letter = next_letters[1];
-            string NEXT_STATE = "(" + next_state + "-(search_1st_head))";
-            if (next_state == ACCEPTING_STATE) {
-                NEXT_STATE = ACCEPTING_STATE;
-            }
-            if (next_state == REJECTING_STATE) {
-                NEXT_STATE = REJECTING_STATE;
-            }
+            // all letters are known, so apply the transition, starting from the k-th tape
+            const SourceMove &move = moves.at(child);
+            GeneratedState next_state(move.next_state, -1, halting[move.next_state] ? HALT : COLLECT);
+            translate_apply(COLLECT_STATE, symbols.with_head(letter), state, child, trie.letters(child), move, next_state, num_tapes);
+        }
+    }
 
-            // when separator is found, go left
-            transitions[make_pair(GO_1ST_HEAD_STATE, vector<string>{SEPARATOR})] = make_tuple(GO_1ST_HEAD_STATE, vector<string>{SEPARATOR}, "<");
-
-            // prepare for finding the 2nd head (creating similar states)
-            const string GO_2ND_HEAD_STATE = "(" + state + "-(" + letterA + ")-(" + letterB + ")-(go_2nd_head))";
-            transitions[make_pair(GO_2ND_HEAD_STATE, vector<string>{SEPARATOR})] = make_tuple(GO_2ND_HEAD_STATE, vector<string>{SEPARATOR}, ">");
-
-            for (const auto &letter: tm.working_alphabet()) {
-                // when a letter without a head is found, continue going left/right
-                transitions[make_pair(GO_1ST_HEAD_STATE, vector<string>{letter})] = make_tuple(GO_1ST_HEAD_STATE, vector<string>{letter}, "<");
-                transitions[make_pair(GO_2ND_HEAD_STATE, vector<string>{letter})] = make_tuple(GO_2ND_HEAD_STATE, vector<string>{letter}, ">");
-
-                // when the 1st head is found, do the operation (move head and put new letter)
-                const string PUT_1ST_HEAD_STATE = "(" + state + "-(" + letterA + ")-(" + letterB + ")-(put_1st_head))";
-                if (tape_1st_head_move == '<') {
-                    transitions[make_pair(GO_1ST_HEAD_STATE, vector<string>{mapping.at(letterA)})] = make_tuple(PUT_1ST_HEAD_STATE, vector<string>{tape_1st_next_letter}, "<");
-                    for (const auto &any_letter: tm.working_alphabet()) {
-                        transitions[make_pair(PUT_1ST_HEAD_STATE, vector<string>{any_letter})] = make_tuple(GO_2ND_HEAD_STATE, vector<string>{mapping.at(any_letter)}, ">");
-                    }
-                }
-                if (tape_1st_head_move == '-') {
-                    transitions[make_pair(GO_1ST_HEAD_STATE, vector<string>{mapping.at(letterA)})] = make_tuple(GO_2ND_HEAD_STATE, vector<string>{mapping.at(tape_1st_next_letter)}, ">");
-                }
-                // if the next head move is right, then we need to check if there is space
-                if (tape_1st_head_move == '>') {
-                    const string PUT_1ST_HEAD_WITH_CHECK_STATE = "(" + state + "-(" + letterA + ")-(" + letterB + ")-(put_1st_head_with_check))";
-
-                    transitions[make_pair(GO_1ST_HEAD_STATE, vector<string>{mapping.at(letterA)})] = make_tuple(PUT_1ST_HEAD_WITH_CHECK_STATE, vector<string>{tape_1st_next_letter}, ">");
-
-                    // no separator found, put the head there
-                    for (const auto &any_letter: tm.working_alphabet()) {
-                        transitions[make_pair(PUT_1ST_HEAD_WITH_CHECK_STATE, vector<string>{any_letter})] = make_tuple(GO_2ND_HEAD_STATE, vector<string>{mapping.at(any_letter)}, ">");
-                    }
-
-                    // if we find a separator where we want to move the head, then we must shift everything one to the right
-                    const string SHIFT_ALL_STATE = "(" + state + "-(" + letterA + ")-(" + letterB + ")-(shift_all))";
-                    transitions[make_pair(PUT_1ST_HEAD_WITH_CHECK_STATE, vector<string>{SEPARATOR})] = make_tuple(SHIFT_ALL_STATE, vector<string>{SEPARATOR}, ">");
-
-                    // go right until we find the end-tape char
-                    for (const auto &any_letter_shift: tm.working_alphabet()) {
-                        transitions[make_pair(SHIFT_ALL_STATE, vector<string>{any_letter_shift})] = make_tuple(SHIFT_ALL_STATE, vector<string>{any_letter_shift}, ">");
-                        transitions[make_pair(SHIFT_ALL_STATE, vector<string>{mapping.at(any_letter_shift)})] = make_tuple(SHIFT_ALL_STATE, vector<string>{mapping.at(any_letter_shift)}, ">");
-                    }
-
-                    const string SHIFT_EACH_STATE = "(" + state + "-(" + letterA + ")-(" + letterB + ")-(shift_each))";
-                    const string SHIFT_END_TAPE_STATE = "(" + state + "-(" + letterA + ")-(" + letterB + ")-(shift_end_tape))";
-                    const string GO_ONE_LEFT_INIT_STATE = "(" + state + "-(" + letterA + ")-(" + letterB + ")-(go_one_left_init_state))";
-
-                    // tape-end found, now we have to shift each cell until we find a separator
-                    transitions[make_pair(SHIFT_ALL_STATE, vector<string>{TAPE_END})] = make_tuple(SHIFT_END_TAPE_STATE, vector<string>{BLANK}, ">");
-                    transitions[make_pair(SHIFT_END_TAPE_STATE, vector<string>{BLANK})] = make_tuple(GO_ONE_LEFT_INIT_STATE, vector<string>{TAPE_END}, "<");
-
-                    transitions[make_pair(GO_ONE_LEFT_INIT_STATE, vector<string>{BLANK})] = make_tuple(SHIFT_EACH_STATE, vector<string>{BLANK}, "<");
-
-                    for (const auto &any_letter: tm.working_alphabet()) {
-                        const string SHIFT_PUT_STATE1 = "(" + state + "-(" + letterA + ")-(" + letterB + ")-(" + any_letter + ")-(shift_put_state1))";
-                        const string GO_ONE_LEFT_STATE1 = "(" + state + "-(" + letterA + ")-(" + letterB + ")-(" + any_letter + ")-(go_one_left_state1))";
-                        transitions[make_pair(SHIFT_EACH_STATE, vector<string>{any_letter})] = make_tuple(SHIFT_PUT_STATE1, vector<string>{BLANK}, ">");
-                        transitions[make_pair(SHIFT_PUT_STATE1, vector<string>{BLANK})] = make_tuple(GO_ONE_LEFT_STATE1, vector<string>{any_letter}, "<");
-                        transitions[make_pair(GO_ONE_LEFT_STATE1, vector<string>{BLANK})] = make_tuple(SHIFT_EACH_STATE, vector<string>{BLANK}, "<");
-
-                        const auto &mapped_letter = mapping.at(any_letter);
-                        const string SHIFT_PUT_STATE2 = "(" + state + "-(" + letterA + ")-(" + letterB + ")-(" + mapped_letter + ")-(shift_put_state2))";
-                        const string GO_ONE_LEFT_STATE2 = "(" + state + "-(" + letterA + ")-(" + letterB + ")-(" + mapped_letter + ")-(go_one_left_state2))";
-                        transitions[make_pair(SHIFT_EACH_STATE, vector<string>{mapped_letter})] = make_tuple(SHIFT_PUT_STATE2, vector<string>{BLANK}, ">");
-                        transitions[make_pair(SHIFT_PUT_STATE2, vector<string>{BLANK})] = make_tuple(GO_ONE_LEFT_STATE2, vector<string>{mapped_letter}, "<");
-                        transitions[make_pair(GO_ONE_LEFT_STATE2, vector<string>{BLANK})] = make_tuple(SHIFT_EACH_STATE, vector<string>{BLANK}, "<");
-                    }
-                    const string SHIFT_PUT_SEPARATOR_STATE = "(" + state + "-(" + letterA + ")-(" + letterB + ")-(" + SEPARATOR + ")-(shift_put_separator_state))";
-                    const string GO_ONE_LEFT_SEPARATOR_STATE = "(" + state + "-(" + letterA + ")-(" + letterB + ")-(" + SEPARATOR + ")-(go_one_left_separator_state))";
-
-                    // all shifted, separator found
-                    transitions[make_pair(SHIFT_EACH_STATE, vector<string>{SEPARATOR})] = make_tuple(SHIFT_PUT_SEPARATOR_STATE, vector<string>{BLANK}, ">");
-                    transitions[make_pair(SHIFT_PUT_SEPARATOR_STATE, vector<string>{BLANK})] = make_tuple(GO_ONE_LEFT_SEPARATOR_STATE, vector<string>{SEPARATOR}, "<");
-                    transitions[make_pair(GO_ONE_LEFT_SEPARATOR_STATE, vector<string>{BLANK})] = make_tuple(GO_2ND_HEAD_STATE, vector<string>{mapping.at(BLANK)}, ">");
-                }
-
-                // when the 2nd head is found, do the operation (put new letter and move head)
-                const string PUT_2ND_HEAD_STATE = "(" + state + "-(" + letterA + ")-(" + letterB + ")-(put_2nd_head))";
-                if (tape_2nd_head_move == '<') {
-                    transitions[make_pair(GO_2ND_HEAD_STATE, vector<string>{mapping.at(letterB)})] = make_tuple(PUT_2ND_HEAD_STATE, vector<string>{tape_2nd_next_letter}, "<");
-                    for (const auto &any_letter: tm.working_alphabet()) {
-                        transitions[make_pair(PUT_2ND_HEAD_STATE, vector<string>{any_letter})] = make_tuple(NEXT_STATE, vector<string>{mapping.at(any_letter)}, "<");
-                    }
-                }
-                if (tape_2nd_head_move == '-') {
-                    transitions[make_pair(GO_2ND_HEAD_STATE, vector<string>{mapping.at(letterB)})] = make_tuple(NEXT_STATE, vector<string>{mapping.at(tape_2nd_next_letter)}, "<");
-                }
-                // if the next head move is right, then we need to check if there is no tape-end
-                if (tape_2nd_head_move == '>') {
-                    const string PUT_2ND_HEAD_WITH_CHECK_STATE = "(" + state + "-(" + letterA + ")-(" + letterB + ")-(put_2nd_head_with_check))";
-                    const string PUT_TAPE_END_AFTER_2ND_HEAD_STATE = "(" + state + "-(" + letterA + ")-(" + letterB + ")-(put_tape_end_after_2nd_head))";
-                    const string GO_BACK_AFTER_PUTTING_TAPE_END_STATE = "(" + state + "-(" + letterA + ")-(" + letterB + ")-(go_back_after_putting_tape_end))";
-
-                    // 2nd head found, check if there is space to the right
-                    transitions[make_pair(GO_2ND_HEAD_STATE, vector<string>{mapping.at(letterB)})] = make_tuple(PUT_2ND_HEAD_WITH_CHECK_STATE, vector<string>{tape_2nd_next_letter}, ">");
-
-                    // there is no tape-end
-                    for (const auto &any_letter: tm.working_alphabet()) {
-                        transitions[make_pair(PUT_2ND_HEAD_WITH_CHECK_STATE, vector<string>{any_letter})] = make_tuple(NEXT_STATE, vector<string>{mapping.at(any_letter)}, "<");
-                    }
-
-                    // there is a tape-end
-                    transitions[make_pair(PUT_2ND_HEAD_WITH_CHECK_STATE, vector<string>{TAPE_END})] = make_tuple(PUT_TAPE_END_AFTER_2ND_HEAD_STATE, vector<string>{mapping.at(BLANK)}, ">");
-                    transitions[make_pair(PUT_TAPE_END_AFTER_2ND_HEAD_STATE, vector<string>{BLANK})] = make_tuple(GO_BACK_AFTER_PUTTING_TAPE_END_STATE, vector<string>{TAPE_END}, "<");
-                    transitions[make_pair(GO_BACK_AFTER_PUTTING_TAPE_END_STATE, vector<string>{mapping.at(BLANK)})] = make_tuple(NEXT_STATE, vector<string>{mapping.at(BLANK)}, "<");
-                }
-            }
+private:
+    generated_transitions_t &transitions;
+    const TapeSymbols &symbols;
+    const int num_tapes;
+
+    void add(const GeneratedState &from, int symbol, const GeneratedState &to, int new_symbol, char direction) {
+        GeneratedMove move{to, new_symbol, direction};
+        auto inserted = transitions.insert(make_pair(make_pair(from, symbol), move));
+        if (!inserted.second)
+            inserted.first->second = move;
+    }
+
+    // performs the transition on the a-th tape, when the head with the given symbol is found in the from state
+    void translate_apply(const GeneratedState &from, int symbol, int state, int node, const vector<int> &letters,
+                         const SourceMove &move, const GeneratedState &next_state, int a) {
+        const int BLANK_LETTER = symbols.blank;
+        const int next_letter = move.next_letters[a - 1];
+        const char head_move = move.head_moves[a - 1];
+
+        // after that, we go to the head on the previous tape, or start the next step if this is the 1st tape
+        const GeneratedState SEEK_STATE(state, node, SEEK, a - 1);
+        const GeneratedState &DONE_STATE = a == 1 ? next_state : SEEK_STATE;
+        const char done_direction = a == 1 ? '-' : '<';
+
+        if (head_move == '-') {
+            add(from, symbol, DONE_STATE, symbols.with_head(next_letter), done_direction);
+        }
+        if (head_move == '<') {
+            const GeneratedState PUT_LEFT_STATE(state, node, PUT_LEFT, a);
+            add(from, symbol, PUT_LEFT_STATE, next_letter, '<');
+            // there is no transition for a separator, as then the head falls off the tape
+            for (int any_letter = 0; any_letter < symbols.num_letters; ++any_letter)
+                add(PUT_LEFT_STATE, any_letter, DONE_STATE, symbols.with_head(any_letter), done_direction);
+        }
+        // if the next head move is right, then we need to check if there is space
+        if (head_move == '>') {
+            const GeneratedState PUT_RIGHT_STATE(state, node, PUT_RIGHT, a);
+            add(from, symbol, PUT_RIGHT_STATE, next_letter, '>');
+            for (int any_letter = 0; any_letter < symbols.num_letters; ++any_letter)
+                add(PUT_RIGHT_STATE, any_letter, DONE_STATE, symbols.with_head(any_letter), done_direction);
+
+            // once there is space, we are on the new head on this tape
+            const GeneratedState AFTER_SHIFT_STATE(state, node, AFTER_SHIFT, a);
+            const GeneratedState &SHIFTED_STATE = a == 1 ? next_state : AFTER_SHIFT_STATE;
+            if (a > 1)
+                add(AFTER_SHIFT_STATE, symbols.with_head(BLANK_LETTER), SEEK_STATE, symbols.with_head(BLANK_LETTER), '<');
+
+            if (a == num_tapes) {
+                // there is a tape-end, move it one to the right
+                const GeneratedState PUT_TAPE_END_STATE(state, node, PUT_TAPE_END, a);
+                add(PUT_RIGHT_STATE, symbols.tape_end(), PUT_TAPE_END_STATE, symbols.with_head(BLANK_LETTER), '>');
+                add(PUT_TAPE_END_STATE, BLANK_LETTER, SHIFTED_STATE, symbols.tape_end(), '<');
+            } else
+                translate_shift(PUT_RIGHT_STATE, state, node, a, SHIFTED_STATE);
+        }
+
+        if (a > 1) {
+            // go left to the head on the previous tape
+            for (int letter = 0; letter < symbols.num_letters; ++letter)
+                add(SEEK_STATE, letter, SEEK_STATE, letter, '<');
+            add(SEEK_STATE, symbols.separator(), SEEK_STATE, symbols.separator(), '<');
+            translate_apply(SEEK_STATE, symbols.with_head(letters[a - 2]), state, node, letters, move, next_state, a - 1);
         }
     }
-}
 
-transitions_t translate_transitions(const TuringMachine &tm, const IdentifiersMapping &mapping,
-                                    const string &SEPARATOR, const string &TAPE_END) {
-    transitions_t transitions;
-    auto set_of_states = tm.set_of_states();
-    for (const auto &state: set_of_states) {
-        if (state == ACCEPTING_STATE || state == REJECTING_STATE) {
-            continue;
+    // the head wants to move right onto the separator after the a-th tape: mark it, then shift it
+    // and everything after it one to the right, and put a blank with a head in its place
+    void translate_shift(const GeneratedState &from, int state, int node, int a, const GeneratedState &shifted_state) {
+        const int BLANK_LETTER = symbols.blank;
+        const int SEPARATOR = symbols.separator();
+        const int TAPE_END = symbols.tape_end();
+        const int SHIFTED_SEPARATOR = symbols.shifted_separator();
+
+        const GeneratedState SHIFT_ALL_STATE(state, node, SHIFT_ALL, a);
+        add(from, SEPARATOR, SHIFT_ALL_STATE, SHIFTED_SEPARATOR, '>');
+
+        // go right until we find the end-tape char
+        for (int any_letter_shift = 0; any_letter_shift < symbols.num_letters; ++any_letter_shift) {
+            add(SHIFT_ALL_STATE, any_letter_shift, SHIFT_ALL_STATE, any_letter_shift, '>');
+            add(SHIFT_ALL_STATE, symbols.with_head(any_letter_shift), SHIFT_ALL_STATE, symbols.with_head(any_letter_shift), '>');
+        }
+        add(SHIFT_ALL_STATE, SEPARATOR, SHIFT_ALL_STATE, SEPARATOR, '>');
+
+        const GeneratedState SHIFT_EACH_STATE(state, node, SHIFT_EACH, a);
+        const GeneratedState SHIFT_END_TAPE_STATE(state, node, SHIFT_END_TAPE, a);
+        const GeneratedState GO_ONE_LEFT_INIT_STATE(state, node, GO_ONE_LEFT_INIT, a);
+        const GeneratedState GO_ONE_LEFT_STATE(state, node, GO_ONE_LEFT, a);
+
+        // tape-end found, now we have to shift each cell until we find the marked separator
+        add(SHIFT_ALL_STATE, TAPE_END, SHIFT_END_TAPE_STATE, BLANK_LETTER, '>');
+        add(SHIFT_END_TAPE_STATE, BLANK_LETTER, GO_ONE_LEFT_INIT_STATE, TAPE_END, '<');
+        add(GO_ONE_LEFT_INIT_STATE, BLANK_LETTER, SHIFT_EACH_STATE, BLANK_LETTER, '<');
+        add(GO_ONE_LEFT_STATE, BLANK_LETTER, SHIFT_EACH_STATE, BLANK_LETTER, '<');
+
+        for (int any_symbol = 0; any_symbol <= SEPARATOR; ++any_symbol) {
+            const GeneratedState SHIFT_PUT_STATE(state, node, SHIFT_PUT, a, any_symbol);
+            add(SHIFT_EACH_STATE, any_symbol, SHIFT_PUT_STATE, BLANK_LETTER, '>');
+            add(SHIFT_PUT_STATE, BLANK_LETTER, GO_ONE_LEFT_STATE, any_symbol, '<');
+        }
+
+        // all shifted, the marked separator found
+        const GeneratedState SHIFT_PUT_SEPARATOR_STATE(state, node, SHIFT_PUT_SEPARATOR, a);
+        add(SHIFT_EACH_STATE, SHIFTED_SEPARATOR, SHIFT_PUT_SEPARATOR_STATE, symbols.with_head(BLANK_LETTER), '>');
+        add(SHIFT_PUT_SEPARATOR_STATE, BLANK_LETTER, shifted_state, SEPARATOR, '<');
+    }
+};
+
+// turns the generated states into identifiers, building each name only once
+transitions_t name_generated_transitions(const generated_transitions_t &generated, const LetterTrie &trie,
+                                         const vector<string> &set_of_states, const TapeSymbols &symbols) {
+    unordered_map<GeneratedState, string, GeneratedStateHash> names;
+    auto name = [&](const GeneratedState &s) -> const string & {
+        auto it = names.find(s);
+        if (it != names.end())
+            return it->second;
+        string res = set_of_states[s.state];
+        if (s.phase != HALT) {
+            res = "(" + res;
+            for (int letter: trie.letters(s.node))
+                res += "-(" + symbols.names[letter] + ")";
+            if (s.tape >= 0)
+                res += "-" + number_identifier(s.tape);
+            if (s.letter >= 0)
+                res += "-(" + symbols.names[s.letter] + ")";
+            res += "-(" + string(PHASE_NAMES[s.phase]) + "))";
         }
-        translate_state_transitions(transitions, state, tm, mapping, SEPARATOR, TAPE_END);
+        return names[s] = res;
+    };
+    transitions_t transitions;
+    for (const auto &transition: generated) {
+        const GeneratedMove &move = transition.second;
+        transitions[make_pair(name(transition.first.first), vector<string>{symbols.names[transition.first.second]})]
+            = make_tuple(name(move.state), vector<string>{symbols.names[move.symbol]}, string(1, move.direction));
     }
     return transitions;
 }
 
+transitions_t translate_transitions(const TuringMachine &tm, const vector<string> &set_of_states,
+                                    const vector<string> &alphabet, const IdentifiersMapping &mapping,
+                                    const string &SEPARATOR, const string &TAPE_END, const string &SHIFTED_SEPARATOR) {
+    TapeSymbols symbols(alphabet, mapping, SEPARATOR, TAPE_END, SHIFTED_SEPARATOR);
+    auto state_id = [&](const string &state) -> int {
+        return lower_bound(set_of_states.begin(), set_of_states.end(), state) - set_of_states.begin();
+    };
+    auto letter_id = [&](const string &letter) -> int {
+        return lower_bound(alphabet.begin(), alphabet.end(), letter) - alphabet.begin();
+    };
+    vector<bool> halting(set_of_states.size());
+    halting[state_id(ACCEPTING_STATE)] = halting[state_id(REJECTING_STATE)] = true;
+
+    // moves[node] - the transition whose letters are the ones in the node
+    LetterTrie trie;
+    map<int, SourceMove> moves;
+    for (const auto &transition: tm.transitions) {
+        int state = state_id(transition.first.first);
+        int node = -1;
+        for (const auto &letter: transition.first.second)
+            node = trie.add_child(state, node, letter_id(letter));
+        SourceMove &move = moves[node];
+        move.next_state = state_id(get<0>(transition.second));
+        for (const auto &letter: get<1>(transition.second))
+            move.next_letters.emplace_back(letter_id(letter));
+        move.head_moves = get<2>(transition.second);
+    }
+
+    // the state whose transitions go through each node
+    vector<int> node_state(trie.parent.size());
+    for (const auto &el: trie.root_children)
+        node_state[el.second] = el.first.first;
+    for (size_t node = 0; node < trie.parent.size(); ++node)
+        if (trie.parent[node] >= 0)
+            node_state[node] = node_state[trie.parent[node]];
+
+    // which letters may follow each prefix, i.e. for which letters collect transitions are needed
+    map<pair<int, int>, vector<int>> next_letters; // (state, node) -> letters
+    for (const auto &el: trie.root_children)
+        next_letters[make_pair(el.first.first, -1)].emplace_back(el.first.second);
+    for (size_t node = 0; node < trie.parent.size(); ++node)
+        for (const auto &el: trie.children[node])
+            next_letters[make_pair(node_state[node], node)].emplace_back(el.first);
+
+    generated_transitions_t transitions;
+    TransitionsTranslator translator(transitions, symbols, tm.num_tapes);
+    for (const auto &el: next_letters)
+        translator.translate_collect(el.first.first, el.first.second, trie, el.second, moves, halting);
+    return name_generated_transitions(transitions, trie, set_of_states, symbols);
+}
+
 int calc_max_depth(const string &s) {
     int depth = 0;
     int max_depth = 0;
@@ -548,18 +1187,63 @@ IdentifiersMapping map_letters_from_alphabet(const vector<string> &alphabet, int
     return mapping;
 }
 
-TuringMachine translate_tm(const TuringMachine &tm) {
-    int parentheses_to_add = calc_max_depth_foreach(tm.working_alphabet()) + 1;
+// the family of a generated state is its last parenthesized component,
+// e.g. "((start)-(a)-(b)-(shift_each))" -> "shift_each", "(init_1st_tape)" -> "init_1st_tape"
+string state_family(const string &state) {
+    string inner = state;
+    if (inner.size() >= 2 && inner.front() == '(' && inner.back() == ')')
+        inner = inner.substr(1, inner.size() - 2);
+    if (inner.empty() || inner.back() != ')')
+        return inner;
+    int depth = 0;
+    for (size_t pos = inner.size(); pos-- > 0;) {
+        if (inner[pos] == ')')
+            depth++;
+        if (inner[pos] == '(' && --depth == 0)
+            return inner.substr(pos + 1, inner.size() - pos - 2);
+    }
+    return inner;
+}
+
+static double seconds_since(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+TuringMachine translate_tm(const TuringMachine &tm, TranslationStats *stats) {
+    auto start = chrono::steady_clock::now();
+    const vector<string> alphabet = tm.working_alphabet();
+    if (stats)
+        stats->working_alphabet_time = seconds_since(start);
+
+    start = chrono::steady_clock::now();
+    const vector<string> set_of_states = tm.set_of_states();
+    if (stats)
+        stats->set_of_states_time = seconds_since(start);
 
-    IdentifiersMapping mapping = map_letters_from_alphabet(tm.working_alphabet(), parentheses_to_add);
+    int parentheses_to_add = calc_max_depth_foreach(alphabet) + 1;
+
+    IdentifiersMapping mapping = map_letters_from_alphabet(alphabet, parentheses_to_add);
     const string SEPARATOR = wrap_with_parentheses("(separator)", parentheses_to_add + 1);
     const string TAPE_END = wrap_with_parentheses("(tape-end)", parentheses_to_add + 1);
+    const string SHIFTED_SEPARATOR = wrap_with_parentheses("(shifted-separator)", parentheses_to_add + 1);
 
+    start = chrono::steady_clock::now();
     auto init_transitions = create_init_transitions(tm, mapping, SEPARATOR, TAPE_END);
-    auto translated_transitions = translate_transitions(tm, mapping, SEPARATOR, TAPE_END);
+    if (stats)
+        stats->init_transitions_time = seconds_since(start);
+
+    start = chrono::steady_clock::now();
+    auto translated_transitions = translate_transitions(tm, set_of_states, alphabet, mapping, SEPARATOR, TAPE_END, SHIFTED_SEPARATOR);
+    if (stats)
+        stats->translate_transitions_time = seconds_since(start);
 
     translated_transitions.insert(init_transitions.begin(), init_transitions.end());
-    TuringMachine one_tape_tm = TuringMachine(1, tm.input_alphabet, translated_transitions);
+    if (stats) {
+        stats->num_transitions = translated_transitions.size();
+        for (const auto &transition: translated_transitions)
+            stats->transitions_per_family[state_family(transition.first.first)]++;
+    }
+    TuringMachine one_tape_tm = TuringMachine(1, tm.input_alphabet, move(translated_transitions));
     return one_tape_tm;
 }
 
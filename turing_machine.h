@@ -1,11 +1,16 @@
 #ifndef __TURING_MACHINE_H
 #define __TURING_MACHINE_H
 
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <map>
+#include <new>
+#include <stdexcept>
 #include <string>
 #include <tuple>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -25,6 +30,8 @@
 #define HEAD_RIGHT '>'
 #define HEAD_STAY '-'
 
+#define CACHE_LINE_SIZE 64
+
 typedef std::map<std::pair<std::string, std::vector<std::string>>, std::tuple<std::string, std::vector<std::string>, std::string>> transitions_t;
 
 struct TuringMachine {
@@ -53,8 +60,145 @@ static inline std::ostream &operator<<(std::ostream &output, const TuringMachine
     return output;
 }
 
+// thrown by read_tm_from_file and read_profile, what() is the whole message (with the line number)
+struct SyntaxError : std::runtime_error {
+    explicit SyntaxError(const std::string &message) : std::runtime_error(message) {}
+};
+
+// closes the input file, throws SyntaxError if the machine is not valid
 TuringMachine read_tm_from_file(FILE *input);
 
-TuringMachine translate_tm(const TuringMachine &tm);
+// for the command-line tools: prints the syntax error and exits instead of throwing
+TuringMachine read_tm_or_exit(FILE *input);
+
+enum RunResult { RUN_ACCEPT, RUN_REJECT, RUN_STEP_LIMIT };
+
+// how many times each transition was taken: (state, [letter_on_tape_1, ..., letter_on_tape_k]) -> count
+typedef std::map<std::pair<std::string, std::vector<std::string>>, long long> profile_t;
+
+void save_profile(std::ostream &output, const profile_t &profile);
+
+// closes the input file, throws SyntaxError if the profile is not valid
+profile_t read_profile(FILE *input);
+
+// allocates memory aligned to cache lines
+template<typename T>
+struct CacheLineAllocator {
+    typedef T value_type;
+    
+    CacheLineAllocator() {}
+    
+    template<typename U>
+    CacheLineAllocator(const CacheLineAllocator<U> &) {}
+    
+    T *allocate(size_t n) {
+        void *res;
+        if (posix_memalign(&res, CACHE_LINE_SIZE, n * sizeof(T)) != 0)
+            throw std::bad_alloc();
+        return static_cast<T *>(res);
+    }
+    
+    void deallocate(T *p, size_t) {
+        free(p);
+    }
+};
+
+template<typename T, typename U>
+bool operator==(const CacheLineAllocator<T> &, const CacheLineAllocator<U> &) {
+    return true;
+}
+
+template<typename T, typename U>
+bool operator!=(const CacheLineAllocator<T> &, const CacheLineAllocator<U> &) {
+    return false;
+}
+
+// where CompiledTuringMachine::run keeps the tapes: in memory by default; if directory is given,
+// each tape is kept in a file there, and only its resident_pages most recently used pages
+// of page_size cells (rounded up to a power of two, at most MAX_PAGE_SIZE) are held in memory
+#define MAX_PAGE_SIZE (1 << 26)
+
+struct TapeOptions {
+    std::string directory;
+    size_t page_size = 1 << 16;
+    size_t resident_pages = 16;
+};
+
+// the same machine with states and letters replaced by consecutive ids,
+// meant for running it on many inputs (the semantics are those of tm_interpreter)
+struct CompiledTuringMachine {
+    int num_tapes;
+    
+    std::vector<std::string> states;  // id -> state
+    std::vector<std::string> letters; // id -> letter
+    int initial_state, accepting_state, rejecting_state, blank;
+    
+    // with a profile, the hottest states, letters and transitions get the smallest ids,
+    // and the transitions from each state occupy whole cache lines
+    explicit CompiledTuringMachine(const TuringMachine &tm, const profile_t *profile = nullptr);
+    
+    // input has to be a result of TuringMachine::parse_input
+    std::vector<int> encode_input(const std::vector<std::string> &input) const;
+    
+    // makes at most max_steps steps; the number of steps actually made is stored in steps;
+    // if hits is given, hits[i] is increased every time the i-th transition is taken;
+    // throws runtime_error if a tape file cannot be created, read or written
+    RunResult run(const std::vector<int> &input, long long max_steps, long long &steps,
+                  std::vector<long long> *hits = nullptr, const TapeOptions *tape_options = nullptr) const;
+    
+    size_t num_transitions() const;
+    
+    // hits collected by run -> the profile
+    profile_t profile(const std::vector<long long> &hits) const;
+
+private:
+    std::map<std::string, int> letter_ids;
+    
+    // (state, [letter_on_tape_1, ..., letter_on_tape_k]) is encoded as
+    // state * row_size + the letters as a number in base letters.size(), where row_size is at least
+    // letters.size()^k; this number indexes dense_table for the first dense_states states (all of them
+    // if the table is small enough, as many of the hottest ones as fit with a profile), and is a key
+    // of sparse_table otherwise; the value is the index of the transition (-1 in dense_table if there is none)
+    uint64_t row_size;
+    uint64_t dense_states;
+    std::vector<int, CacheLineAllocator<int>> dense_table;
+    std::unordered_map<uint64_t, int> sparse_table;
+    
+    // if the encoding does not fit in 64 bits, the transitions are kept in wide_table instead,
+    // under the key [state, letter_on_tape_1, ..., letter_on_tape_k]
+    bool wide_keys;
+    std::map<std::vector<int>, int> wide_table;
+    
+    // i-th transition, starting at actions[i * (1 + 2 * num_tapes)]:
+    // the next state, the new letters on tapes 1, ..., k, and the moves on tapes 1, ..., k (-1, 0 or 1)
+    std::vector<int> actions;
+    
+    // i-th transition, starting at sources[i * (1 + num_tapes)]: the state and the letters it is taken from
+    std::vector<int> sources;
+    
+    // letters are the ones under the heads on tapes 1, ..., k
+    int find_transition(int state, const int *letters_under_heads) const;
+    
+    template<typename Tape>
+    RunResult run_on(std::vector<Tape> &tapes, long long max_steps, long long &steps,
+                     std::vector<long long> *hits) const;
+};
+
+// where the translator spends its time (in seconds) and what it produces
+struct TranslationStats {
+    double working_alphabet_time = 0;
+    double set_of_states_time = 0;
+    double init_transitions_time = 0;
+    double translate_transitions_time = 0;
+    double save_to_file_time = 0; // filled in by whoever saves the machine
+    
+    // family of the state a transition starts in (e.g. "collect", "seek", "shift_each", "init_go_back") -> number of transitions
+    std::map<std::string, size_t> transitions_per_family;
+    size_t num_transitions = 0;
+    
+    long peak_rss_kb = 0; // filled in by the caller, at the very end
+};
+
+TuringMachine translate_tm(const TuringMachine &tm, TranslationStats *stats = nullptr);
 
 #endif